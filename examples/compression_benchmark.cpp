@@ -0,0 +1,140 @@
+#include <fanel/Tcp_connector.h>
+#include <fanel/Tcp_acceptor.h>
+#include <boost/lexical_cast.hpp>
+#include <sys/time.h>
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//Sends a batch of messages over loopback and reports how long it took until all were received.
+//Build it with and without USE_ZSTD or USE_ZLIB to compare the compressed and uncompressed paths.
+//Loopback is not bandwidth bound, so with compression also the size on the network is reported.
+
+const int port = 6010;
+
+double now() {
+    timeval time;
+    gettimeofday(&time, 0);
+    return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+//repetitive records, like the logs and json our links carry
+std::string make_message(size_t size, int sequence) {
+    std::string message;
+    message.reserve(size + 128);
+    int record = 0;
+    while (message.size() < size) {
+        message += "{\"sequence\":" + boost::lexical_cast<std::string>(sequence) +
+            ",\"record\":" + boost::lexical_cast<std::string>(record) +
+            ",\"status\":\"ok\",\"host\":\"node-" + boost::lexical_cast<std::string>(record % 7) + ".example.com\"}\n";
+        record++;
+    }
+    message.resize(size);
+    return message;
+}
+
+class Server : public Tcp_acceptor<> {
+  public:
+    Server(boost::asio::io_service& io_service_, const std::vector<std::string>& messages_) : Tcp_acceptor<>(io_service_), io_service(io_service_), connection(0), messages(messages_), count(0) {}
+    ~Server() { delete connection; }
+
+    void accepted(Connection* connection_) { connection = connection_; }
+
+    void received(Connection* connection, const char* data, int size) {
+        const std::string& message = messages[count];
+        if ((size_t)size != message.size() || memcmp(data, message.data(), size) != 0) {
+            std::cout << "Message " << count << " was corrupted" << std::endl;
+            io_service.stop();
+            return;
+        }
+        if (++count == messages.size()) {
+            finished = now();
+            io_service.stop();
+        }
+    }
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        std::cout << "Server connection failed: " << error_code.message() << std::endl;
+        io_service.stop();
+    }
+
+    void error(const system::error_code& error_code) {
+        std::cout << "Accept failed: " << error_code.message() << std::endl;
+        io_service.stop();
+    }
+
+    boost::asio::io_service& io_service;
+    Connection* connection;
+    const std::vector<std::string>& messages;
+    size_t count;
+    double finished;
+};
+
+class Client : public Tcp_connector<> {
+  public:
+    Client(boost::asio::io_service& io_service_, const std::vector<std::string>& messages_) : Tcp_connector<>(io_service_), io_service(io_service_), connection(0), messages(messages_) {}
+    ~Client() { delete connection; }
+
+    void accepted(Connection* connection_) {
+        connection = connection_;
+        started = now();
+        for (size_t i = 0; i < messages.size(); ++i)
+            connection->write(messages[i].data(), messages[i].size());
+    }
+
+    void received(Connection* connection, const char* data, int size) {}
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        std::cout << "Client connection failed: " << error_code.message() << std::endl;
+        io_service.stop();
+    }
+
+    void error(const system::error_code& error_code) {
+        std::cout << "Connect failed: " << error_code.message() << std::endl;
+        io_service.stop();
+    }
+
+    boost::asio::io_service& io_service;
+    Connection* connection;
+    const std::vector<std::string>& messages;
+    double started;
+};
+
+int main(int argc, const char* argv[]) {
+    size_t message_size = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 4096;
+    size_t message_count = argc > 2 ? boost::lexical_cast<size_t>(argv[2]) : 10000;
+
+    std::vector<std::string> messages;
+    size_t total = 0;
+    for (size_t i = 0; i < message_count; ++i) {
+        messages.push_back(make_message(message_size, i));
+        total += message_size;
+    }
+
+    #ifdef USE_COMPRESSION
+        //a compressor of our own sees the same messages in the same order as the one of the connection, so
+        //it produces the same output. This runs before the clock starts.
+        Message_compressor compressor;
+        std::vector<char> out(compressor.bound(message_size));
+        size_t compressed_total = 0;
+        for (size_t i = 0; i < message_count; ++i)
+            compressed_total += message_size < COMPRESSION_THRESHOLD ? 4 + message_size : COMPRESSED_HEADER_SIZE + compressor.compress(messages[i].data(), message_size, &out[0]);
+        std::cout << compressed_total << " bytes on the network, " << 100.0 * compressed_total / (total + 4 * message_count) << "% of uncompressed, codec " << (int)compressor.codec() << std::endl;
+    #else
+        std::cout << total + 4 * message_count << " bytes on the network, not compressed" << std::endl;
+    #endif
+
+    boost::asio::io_service io_service;
+    Server server(io_service, messages);
+    Client client(io_service, messages);
+    server.accept(port);
+    client.connect("127.0.0.1", port);
+    io_service.run();
+
+    if (server.count != message_count) return 1;
+    double seconds = server.finished - client.started;
+    std::cout << message_count << " messages of " << message_size << " bytes in " << seconds << "s, "
+              << message_count / seconds << " messages/s, " << total / seconds / (1024 * 1024) << " MB/s" << std::endl;
+    return 0;
+}
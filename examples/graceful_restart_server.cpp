@@ -0,0 +1,116 @@
+#include <fanel/Tcp_connection.h>
+#include <fanel/Tcp_acceptor.h>
+#include <boost/lexical_cast.hpp>
+#include <set>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+//An echo server that can be replaced without refusing a single connection. Send it SIGHUP and it
+//starts a new copy of itself that accepts on the same listening socket. The old process stops
+//accepting, drains its connections and exits once the last one is drained.
+
+const boost::posix_time::seconds drain_timeout(10);
+
+class Acceptor : public Tcp_acceptor<> {
+  public:
+    Acceptor(boost::asio::io_service& io_service_, const char* program_, int port_)
+        : Tcp_acceptor<>(io_service_), io_service(io_service_), program(program_), port(port_), restarting(false) {}
+
+    ~Acceptor() {
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    void accepted(Connection* connection) {
+        m_connections.insert(connection);
+        std::string welcome_message = "Welcome from process " + boost::lexical_cast<std::string>(getpid());
+        connection->write(welcome_message.data(), welcome_message.length());
+    }
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        delete connection;
+        m_connections.erase(connection);
+        stop_when_drained();
+    }
+
+    void error(const system::error_code& error_code) {
+        std::cout << "Accept failed: " << error_code.message() << std::endl;
+    }
+
+    void received(Connection* connection, const char* data, int size) {
+        connection->write(data, size);
+    }
+
+    void drained(Connection* connection, const system::error_code& error_code) {
+        if (error_code)
+            std::cout << "A connection did not drain in time: " << error_code.message() << std::endl;
+        delete connection;
+        m_connections.erase(connection);
+        stop_when_drained();
+    }
+
+    //hand the listening socket to a new process, then drain
+    void restart() {
+        if (restarting) return;
+        int listener = native_handle(port);
+        if (listener < 0) return;
+        fcntl(listener, F_SETFD, 0); //let the new process inherit it
+        if (fork() == 0) {
+            //the connections stay with us, so the new process must not keep their sockets open
+            for (int fd = 3; fd < sysconf(_SC_OPEN_MAX); ++fd) {
+                if (fd != listener) close(fd);
+            }
+            std::string port_str = boost::lexical_cast<std::string>(port);
+            std::string listener_str = boost::lexical_cast<std::string>(listener);
+            execl(program, program, port_str.c_str(), listener_str.c_str(), (char*)0);
+            _exit(1);
+        }
+        //connections that arrive from now on wait in the backlog of the shared socket until the new process accepts them
+        restarting = true;
+        stop_accept();
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it) {
+            (*it)->drain(drain_timeout);
+        }
+        stop_when_drained();
+    }
+
+  private:
+    void stop_when_drained() {
+        if (restarting && m_connections.empty())
+            io_service.stop();
+    }
+
+    boost::asio::io_service& io_service;
+    const char* program;
+    int port;
+    bool restarting;
+    std::set<Connection*> m_connections;
+};
+
+void handle_signal(Acceptor* acceptor, const boost::system::error_code& error_code, int signal) {
+    if (!error_code)
+        acceptor->restart();
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) {
+        std::cout << "usage: ./graceful_restart_server port [listening_socket]" << std::endl;
+        exit(1);
+    }
+    int port = boost::lexical_cast<int>(argv[1]);
+
+    boost::asio::io_service io_service;
+    Acceptor acceptor(io_service, argv[0], port);
+    if (argc > 2)
+        acceptor.accept(port, boost::lexical_cast<int>(argv[2]));
+    else
+        acceptor.accept(port);
+    std::cout << "Process " << getpid() << " serving on port " << port << std::endl;
+
+    boost::asio::signal_set signals(io_service, SIGHUP);
+    signals.async_wait(boost::bind(handle_signal, &acceptor, boost::asio::placeholders::error, boost::asio::placeholders::signal_number));
+    io_service.run();
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <fanel/Tcp_connector.h>
+#include <fanel/Tcp_acceptor.h>
+#include <boost/lexical_cast.hpp>
+#include <sys/time.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+//Measures the latency of small control messages that share a connection with bulk messages.
+//Every millisecond a control message is written, while the bulk messages keep the write queue
+//full. Build it with and without WRITE_PRIORITIES to see what the lanes do for the control traffic.
+
+const int port = 6011;
+const size_t bulk_size = 1024 * 1024;
+const size_t bulk_backlog = 8; //bulk messages written but not yet received
+
+double now() {
+    timeval time;
+    gettimeofday(&time, 0);
+    return time.tv_sec + time.tv_usec / 1000000.0;
+}
+
+class Server : public Tcp_acceptor<> {
+  public:
+    Server(boost::asio::io_service& io_service_, size_t samples_) : Tcp_acceptor<>(io_service_), io_service(io_service_), connection(0), samples(samples_), bulk_received(0) {}
+    ~Server() { delete connection; }
+
+    void accepted(Connection* connection_) { connection = connection_; }
+
+    void received(Connection* connection, const char* data, int size) {
+        if (data[0] == 'b') {
+            bulk_received++;
+            return;
+        }
+        double sent;
+        memcpy(&sent, data + 1, sizeof(sent));
+        latencies.push_back(now() - sent);
+        if (latencies.size() == samples)
+            io_service.stop();
+    }
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        std::cout << "Server connection failed: " << error_code.message() << std::endl;
+        io_service.stop();
+    }
+
+    boost::asio::io_service& io_service;
+    Connection* connection;
+    size_t samples;
+    size_t bulk_received;
+    std::vector<double> latencies;
+};
+
+class Client : public Tcp_connector<> {
+  public:
+    Client(boost::asio::io_service& io_service, Server& server_) : Tcp_connector<>(io_service), server(server_), connection(0), timer(io_service), bulk(bulk_size, 'b'), bulk_sent(0) {}
+    ~Client() { delete connection; }
+
+    void accepted(Connection* connection_) {
+        connection = connection_;
+        tick(boost::system::error_code());
+    }
+
+    void tick(const boost::system::error_code& error_code) {
+        if (error_code) return;
+        while (bulk_sent - server.bulk_received < bulk_backlog) {
+            connection->write(bulk.data(), bulk.size());
+            bulk_sent++;
+        }
+        char control[1 + sizeof(double)];
+        control[0] = 'c';
+        double sent = now();
+        memcpy(control + 1, &sent, sizeof(sent));
+        //without WRITE_PRIORITIES there is a single lane and the priority makes no difference
+        connection->write(control, sizeof(control), 1);
+        timer.expires_from_now(boost::posix_time::milliseconds(1));
+        timer.async_wait(boost::bind(&Client::tick, this, boost::asio::placeholders::error));
+    }
+
+    void received(Connection* connection, const char* data, int size) {}
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        std::cout << "Client connection failed: " << error_code.message() << std::endl;
+    }
+
+    Server& server;
+    Connection* connection;
+    boost::asio::deadline_timer timer;
+    std::string bulk;
+    size_t bulk_sent;
+};
+
+int main(int argc, const char* argv[]) {
+    size_t samples = argc > 1 ? boost::lexical_cast<size_t>(argv[1]) : 2000;
+
+    boost::asio::io_service io_service;
+    Server server(io_service, samples);
+    Client client(io_service, server);
+    //small kernel buffers, so the backlog waits in the write queue where the lanes can reorder it
+    Socket_options options;
+    options.tcp_nodelay = true;
+    options.send_buffer_size = 65536;
+    options.receive_buffer_size = 65536;
+    server.accept(port, options);
+    client.connect("127.0.0.1", port, options);
+    double started = now();
+    io_service.run();
+    double seconds = now() - started;
+
+    std::vector<double>& latencies = server.latencies;
+    if (latencies.size() != samples) return 1;
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "control message latency, p50: " << latencies[samples / 2] * 1000000 << "us"
+              << ", p99: " << latencies[samples * 99 / 100] * 1000000 << "us"
+              << ", max: " << latencies.back() * 1000000 << "us"
+              << ", bulk throughput: " << server.bulk_received * bulk_size / (1024.0 * 1024.0) / seconds << " MB/s" << std::endl;
+    return 0;
+}
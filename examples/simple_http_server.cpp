@@ -1,121 +1,442 @@
 #include <fanel/Tcp_connection.h>
 #include <fanel/Tcp_acceptor.h>
 #include <boost/filesystem.hpp>
-#include <boost/filesystem/fstream.hpp>
-#include <set>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <map>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <memory>
 #include <iostream>
 #include <sstream>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctime>
 
 using namespace boost::filesystem;
 
 filesystem::path root;
 
-struct Get_request {
-    std::map<std::string, std::string> headers;
-    std::string command;
-    std::string uri;
-    std::string protocol;
-
-    bool parse_field(std::string& dst, const char*& current, const char delim, int& remaining) {
-        size_t pos = 0;
-        while(current[pos] != delim && remaining > 0) {
-           pos++;        
-           remaining--;
-        }
-        dst = std::move(std::string(current, pos));
-        current += pos + 1;
-        remaining--;
+//request bodies are read and discarded, but we do not want to buffer just anything
+const size_t max_body_size = 1024*1024;
+
+//longer uris are answered with 414, the same as paths the filesystem finds too long
+const size_t max_uri_size = 8192;
+
+//larger files are not worth the memory, sendfile serves them without copies anyway
+const size_t max_cached_file_size = 256*1024;
+const size_t cache_byte_budget = 64*1024*1024;
+
+/** Keeps complete responses (status line, headers and body) of small files in memory,
+ *  so a hot file is served with a lookup and a write_raw, without touching the filesystem.
+ *
+ *  Entries are keyed by the file they were read from. The normalized request paths that
+ *  resolved to the file, like "" and "index.html" for the index of the root, are aliases
+ *  of the entry, so a warm request does not resolve the path again and a file is kept once.
+ *
+ *  Responses are shared with the write queues of the connections, so replacing or evicting
+ *  an entry never affects a response that is still being written. An entry is checked
+ *  against its file at most once a second and dropped when the file changed. When the
+ *  cached bytes exceed the budget, the least recently used entries are evicted.
+ */
+class File_cache {
+  public:
+    File_cache(size_t byte_budget_) : byte_budget(byte_budget_), cached_bytes(0) {}
+
+    //returns the cached response for the request path, or nothing if there is none or the file changed
+    std::shared_ptr<const std::string> get(const std::string& request_path) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        auto alias = aliases.find(request_path);
+        if (alias == aliases.end()) return std::shared_ptr<const std::string>();
+        auto it = entries.find(alias->second);
+        Entry& entry = it->second;
+        time_t now = time(0);
+        if (now != entry.checked) {
+            struct stat status;
+            if (stat(it->first.c_str(), &status) != 0 || changed(entry, status)) {
+                erase(it);
+                return std::shared_ptr<const std::string>();
+            }
+            entry.checked = now;
+        }
+        lru.splice(lru.begin(), lru, entry.lru);
+        return entry.response;
+    }
+
+    //caches the response built from file for requests of request_path, status is what fstat said
+    //about the file when it was read. If the file is cached already, request_path becomes an alias.
+    void put(const std::string& request_path, const std::string& file, const struct stat& status, std::shared_ptr<const std::string> response) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        auto it = entries.find(file);
+        if (it != entries.end()) {
+            if (!changed(it->second, status)) {
+                alias(request_path, it);
+                return;
+            }
+            erase(it);
+        }
+        lru.push_front(file);
+        Entry& entry = entries[file];
+        entry.response = response;
+        entry.inode = status.st_ino;
+        entry.mtime = status.st_mtim;
+        entry.size = status.st_size;
+        entry.checked = time(0);
+        entry.lru = lru.begin();
+        alias(request_path, entries.find(file));
+        cached_bytes += response->size();
+        while (cached_bytes > byte_budget && lru.size() > 1)
+            erase(entries.find(lru.back()));
+    }
+
+  private:
+    struct Entry {
+        std::shared_ptr<const std::string> response;
+        std::vector<std::string> aliases;
+        ino_t inode;
+        struct timespec mtime; //nanoseconds too, a file rewritten within the second it was cached must not look unchanged
+        off_t size;
+        time_t checked;
+        std::list<std::string>::iterator lru;
+    };
+
+    static bool changed(const Entry& entry, const struct stat& status) {
+        return status.st_ino != entry.inode || status.st_size != entry.size
+            || status.st_mtim.tv_sec != entry.mtime.tv_sec || status.st_mtim.tv_nsec != entry.mtime.tv_nsec;
+    }
+
+    void alias(const std::string& request_path, std::unordered_map<std::string, Entry>::iterator it) {
+        std::string& file = aliases[request_path];
+        if (file == it->first) return;
+        file = it->first;
+        it->second.aliases.push_back(request_path);
+    }
+
+    void erase(std::unordered_map<std::string, Entry>::iterator it) {
+        //an alias may point at another file by now, when the path resolves differently
+        for (size_t i = 0; i < it->second.aliases.size(); ++i) {
+            auto alias = aliases.find(it->second.aliases[i]);
+            if (alias != aliases.end() && alias->second == it->first)
+                aliases.erase(alias);
+        }
+        cached_bytes -= it->second.response->size();
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+
+    std::unordered_map<std::string, Entry> entries; //by file
+    std::unordered_map<std::string, std::string> aliases; //normalized request path to file
+    std::list<std::string> lru; //most recently used first
+    size_t byte_budget;
+    size_t cached_bytes;
+    boost::mutex mutex;
+};
+
+File_cache cache(cache_byte_budget);
+
+//a piece of the received message, parsing a request copies nothing
+struct Field {
+    const char* data;
+    size_t size;
+
+    Field() : data(0), size(0) {}
+    Field(const char* data_, size_t size_) : data(data_), size(size_) {}
+
+    bool equals(const char* other) const {
+        return strlen(other) == size && strncasecmp(data, other, size) == 0;
+    }
+    std::string str() const {
+        return std::string(data, size);
+    }
+};
+
+struct Request {
+    static const int max_headers = 64;
+
+    Field method;
+    Field uri;
+    Field protocol;
+    Field header_names[max_headers];
+    Field header_values[max_headers];
+    int header_count;
+    size_t content_length;
+    bool keep_alive;
+    bool too_many_headers; //parse failed because there are more than max_headers headers
+
+    //splits of the next field ending in delim, returns false if there is none
+    static bool next_field(Field& dst, const char*& current, const char* end, const char* delim) {
+        size_t delim_size = strlen(delim);
+        const char* pos = current;
+        while (pos + delim_size <= end && memcmp(pos, delim, delim_size) != 0)
+            pos++;
+        if (pos + delim_size > end) return false;
+        dst = Field(current, pos - current);
+        current = pos + delim_size;
         return true;
     }
-    
-    void parse(const char* message, int remaining) {
-        //parse request function, performance shouldn't be
-        //too shabby, no parse_field will read more than
-        //remaining characters and it will update remaining
-        //so should be safe as well
-        parse_field(command, message, ' ', remaining);
-        parse_field(uri, message, ' ', remaining);
-        parse_field(protocol, message, '\r', remaining);
-        message++; //drop the newline
-        remaining--;
-        while (remaining > 0) {
-            std::pair<std::string, std::string> header;
-            parse_field(header.first, message, ':', remaining);
-            parse_field(header.second, message, '\r', remaining);
-            headers.insert(header);
-            message++; //drop the newline
-            remaining--;
-        }
-    }
-
-    std::string fetch() {
-        path p = root / uri;
-        if (!exists(p)) return "HTTP/1.0 404 PAGE NOT FOUND\r\n\r\n";
-        if (is_directory(p)) {
-            if (is_regular_file(p / "index.html")) {
-                p /= "index.html";
-            } else if (is_regular_file(p / "index.htm")) {
-                p /= "index.htm";
-            } else {
-                return "HTTP/1.0 404 PAGE NOT FOUND\r\n\r\n";
+
+    //parses the request line and headers, the message is everything up to the empty line (which is not included)
+    bool parse(const char* message, size_t size) {
+        const char* end = message + size;
+        too_many_headers = false;
+        //tolerate empty lines between pipelined requests
+        while (message + 2 <= end && message[0] == '\r' && message[1] == '\n')
+            message += 2;
+        if (!next_field(method, message, end, " ")) return false;
+        if (!next_field(uri, message, end, " ")) return false;
+        if (!next_field(protocol, message, end, "\r\n")) {
+            protocol = Field(message, end - message);
+            message = end;
+        }
+        header_count = 0;
+        while (message < end) {
+            //dropping the rest could drop a Content-Length, and then the body would be read as the next request
+            if (header_count == max_headers) {
+                too_many_headers = true;
+                return false;
+            }
+            Field line;
+            if (!next_field(line, message, end, "\r\n")) {
+                line = Field(message, end - message);
+                message = end;
+            }
+            const char* line_end = line.data + line.size;
+            const char* value = line.data;
+            Field name;
+            if (!next_field(name, value, line_end, ":")) return false;
+            while (value < line_end && (*value == ' ' || *value == '\t'))
+                value++;
+            header_names[header_count] = name;
+            header_values[header_count] = Field(value, line_end - value);
+            header_count++;
+        }
+
+        content_length = 0;
+        const Field* length = header("Content-Length");
+        if (length) {
+            try {
+                content_length = boost::lexical_cast<size_t>(length->str());
+            } catch (boost::bad_lexical_cast&) {
+                return false;
             }
         }
-        std::string page = "HTTP/1.0 200 OK\r\n\r\n";
-        filesystem::ifstream file(p);
-        page.append((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-        return page;
+
+        //HTTP/1.1 keeps the connection open unless asked not to, HTTP/1.0 only when asked to
+        const Field* connection = header("Connection");
+        if (protocol.equals("HTTP/1.1"))
+            keep_alive = !(connection && connection->equals("close"));
+        else
+            keep_alive = connection && connection->equals("keep-alive");
+        return true;
+    }
+
+    const Field* header(const char* name) const {
+        for (int i = 0; i < header_count; ++i) {
+            if (header_names[i].equals(name))
+                return &header_values[i];
+        }
+        return 0;
     }
 };
 
-std::ostream& operator<<(std::ostream& out, const Get_request& request) {
-    out << "Command: " << request.command << std::endl;
-    out << "Uri: " << request.uri << std::endl;
-    out << "Protocol: " << request.protocol << std::endl;
-    out << "Headers: " << std::endl;
-    for (auto it = request.headers.begin(); it != request.headers.end(); ++it) {
-        std::cout<< "\t" << it->first << ": " << it->second << std::endl;
+//builds the status line and headers of a response with a body of body_size bytes
+std::shared_ptr<std::string> respond(const Request& request, const std::string& status, size_t body_size = 0) {
+    std::shared_ptr<std::string> response(new std::string);
+    response->reserve(128);
+    *response += "HTTP/1.1 ";
+    *response += status;
+    *response += "\r\nContent-Length: ";
+    *response += boost::lexical_cast<std::string>(body_size);
+    if (!request.keep_alive)
+        *response += "\r\nConnection: close";
+    else if (!request.protocol.equals("HTTP/1.1"))
+        *response += "\r\nConnection: keep-alive";
+    *response += "\r\n\r\n";
+    return response;
+}
+
+//the path of a uri relative to the document root, without empty and "." segments,
+//so "/" and "//" or "/sub" and "/sub/" are the same path
+std::string normalize(const std::string& uri) {
+    std::string normalized;
+    size_t start = 0;
+    while (start < uri.size()) {
+        size_t end = uri.find('/', start);
+        if (end == std::string::npos) end = uri.size();
+        if (end > start && uri.compare(start, end - start, ".") != 0) {
+            if (!normalized.empty()) normalized += '/';
+            normalized.append(uri, start, end - start);
+        }
+        start = end + 1;
+    }
+    return normalized;
+}
+
+//opens the regular file p names, or the index file of the directory p names, in which case
+//p is extended with it. Returns -1 with errno set if there is none. Nothing here throws,
+//a request must not be able to take the process down.
+int open_file(path& p, struct stat& status) {
+    int fd = open(p.string().c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) return fd;
+    int dir = fd;
+    fd = -1;
+    if (S_ISDIR(status.st_mode)) {
+        const char* indexes[] = { "index.html", "index.htm" };
+        for (size_t i = 0; i < 2 && fd < 0; ++i) {
+            fd = openat(dir, indexes[i], O_RDONLY);
+            if (fd < 0) continue;
+            if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode)) {
+                p /= indexes[i];
+            } else {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    close(dir);
+    if (fd < 0) errno = ENOENT;
+    return fd;
+}
+
+//writes the response to request. Small files are answered from the cache, others are sent
+//with write_file so they are never copied into user space
+void fetch(Tcp_connection* connection, const Request& request) {
+    if (!request.method.equals("GET") && !request.method.equals("HEAD")) {
+        connection->write_raw(respond(request, "501 NOT IMPLEMENTED"));
+        return;
+    }
+    if (request.uri.size > max_uri_size) {
+        connection->write_raw(respond(request, "414 URI TOO LONG"));
+        return;
+    }
+    std::string uri = request.uri.str();
+    uri = uri.substr(0, uri.find('?'));
+    if (uri.find("..") != std::string::npos) {
+        connection->write_raw(respond(request, "403 FORBIDDEN"));
+        return;
+    }
+    std::string request_path = normalize(uri);
+
+    //the cache holds the plain HTTP/1.1 keep-alive responses, everything else is built from the file
+    bool cacheable = request.method.equals("GET") && request.keep_alive && request.protocol.equals("HTTP/1.1");
+    if (cacheable) {
+        std::shared_ptr<const std::string> response = cache.get(request_path);
+        if (response) {
+            connection->write_raw(response);
+            return;
+        }
+    }
+
+    path p = root / request_path;
+    struct stat status;
+    int fd = open_file(p, status);
+    if (fd < 0) {
+        connection->write_raw(respond(request, errno == ENAMETOOLONG ? "414 URI TOO LONG" : "404 PAGE NOT FOUND"));
+        return;
+    }
+    std::shared_ptr<std::string> response = respond(request, "200 OK", status.st_size);
+    if (cacheable && (size_t)status.st_size <= max_cached_file_size) {
+        size_t header_size = response->size();
+        response->resize(header_size + status.st_size);
+        if (pread(fd, &(*response)[header_size], status.st_size, 0) == status.st_size) {
+            cache.put(request_path, p.string(), status, response);
+            connection->write_raw(response);
+            close(fd);
+            return;
+        }
+        response->resize(header_size);
     }
-    return out;
+    connection->write_raw(response);
+    if (!request.method.equals("HEAD"))
+        connection->write_file(fd, 0, status.st_size);
+    close(fd);
 }
 
+//Serves HTTP/1.1 with keep-alive and pipelining. The framework splits the requests
+//on the empty line that ends the headers, a body announced by Content-Length is read
+//with read_raw and discarded. Responses go out in the order the requests came in,
+//because every request is answered from within received.
+//
+//The parsing lives here, not in the library. The whole program is built with the \r\n\r\n
+//DELIMITER framing, so it can not also hold size prefixed connections.
 class Acceptor : public Tcp_acceptor<> {
   public:
-	Acceptor(boost::asio::io_service& io_service) : Tcp_acceptor<>(io_service) {}
-
-	~Acceptor() {
-	    for (auto it = m_connections.begin(); it != m_connections.end(); ++it) {
-	        delete *it;
-	    }
-	}
-	
-	void accepted(Connection* connection) {
-		m_connections.insert(connection);
-	}
-	
-	void error(Connection* connection, const system::error_code& error_code) {
-	    delete connection;
-		m_connections.erase(connection);
-	}
-	
-	void error(const system::error_code& error_code) {
-		std::cout << "Accept failed: " << error_code.message() << std::endl;
-	}
-	
-	void received(Connection* connection, const char* data, int size) {
-	    Get_request request;
-	    request.parse(data, size);
-	    std::cout << request << std::endl;
-        std::string page = request.fetch();
-        connection->write(page.data(), page.size());
-	}
+    Acceptor(boost::asio::io_service& io_service) : Tcp_acceptor<>(io_service) {}
+
+    ~Acceptor() {
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it) {
+            delete it->first;
+        }
+    }
+
+    void accepted(Connection* connection) {
+        m_connections[connection] = State();
+    }
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        delete connection;
+        m_connections.erase(connection);
+    }
+
+    void error(const system::error_code& error_code) {
+        std::cout << "Accept failed: " << error_code.message() << std::endl;
+    }
+
+    void received(Connection* connection, const char* data, int size) {
+        State& state = m_connections[connection];
+        if (state.reading_body) {
+            state.reading_body = false;
+            return;
+        }
+        if (state.closing) return; //ignore anything pipelined after the request that closed the connection
+
+        Tcp_connection* tcp_connection = static_cast<Tcp_connection*>(connection);
+        Request request;
+        if (!request.parse(data, size)) {
+            request.keep_alive = false;
+            state.closing = true;
+            tcp_connection->write_raw(respond(request, request.too_many_headers ? "431 REQUEST HEADER FIELDS TOO LARGE" : "400 BAD REQUEST"));
+            return;
+        }
+        if (request.content_length > max_body_size) {
+            request.keep_alive = false;
+            state.closing = true;
+            tcp_connection->write_raw(respond(request, "413 REQUEST ENTITY TOO LARGE"));
+            return;
+        }
+        if (request.content_length) {
+            tcp_connection->read_raw(request.content_length);
+            state.reading_body = true;
+        }
+        //the connection is deleted once the last response is written
+        if (!request.keep_alive)
+            state.closing = true;
+        fetch(tcp_connection, request);
+    }
 
     void write_done(Connection* connection) {
-        std::cout << "Done writing, disconnecting" << std::endl;
-	    delete connection;
-		m_connections.erase(connection);
+        auto it = m_connections.find(connection);
+        if (it != m_connections.end() && it->second.closing) {
+            delete connection;
+            m_connections.erase(it);
+        }
     }
-	
-    std::set<Connection*> m_connections;
+
+  private:
+    struct State {
+        State() : reading_body(false), closing(false) {}
+        bool reading_body;
+        bool closing;
+    };
+
+    std::map<Connection*, State> m_connections;
 };
 
 int main(int argc, const char* argv[]) {
@@ -123,10 +444,10 @@ int main(int argc, const char* argv[]) {
         std::cout << "usage: ./http_server port document_root"<< std::endl;
         exit(1);
     }
-    
+
     std::string port_str = argv[1];
-    std::string document_root; 
-    for (int i = 2; i < argc; ++i) 
+    std::string document_root;
+    for (int i = 2; i < argc; ++i)
         document_root += argv[i];
 
     std::istringstream istr(port_str);
@@ -134,9 +455,9 @@ int main(int argc, const char* argv[]) {
     istr >> port;
 
     std::cout << "Serving on port: " << port << std::endl;
-    std::cout << "Document root: " << document_root << std::endl;     
+    std::cout << "Document root: " << document_root << std::endl;
 
-    root = path(document_root); 
+    root = path(document_root);
     if (!exists(root) || !is_directory(root))  {
         std::cout << "Path: " << document_root << ", does not exist or is not a directory." <<  std::endl;
         exit(1);
@@ -146,6 +467,6 @@ int main(int argc, const char* argv[]) {
     Acceptor acceptor(io_service);
     acceptor.accept(port);
     io_service.run();
- 
+
     return 0;
 }
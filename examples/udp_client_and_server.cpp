@@ -0,0 +1,59 @@
+#include <fanel/Udp_acceptor.h>
+#include <fanel/Udp_connector.h>
+#include <set>
+#include <iostream>
+
+//receives datagrams on a few ports and sends datagrams to them, every datagram is echoed back once
+class Udp_connector_and_acceptor : public Udp_connector<>, public Udp_acceptor<> {
+  public:
+    Udp_connector_and_acceptor(boost::asio::io_service& io_service) : Udp_connector<>(io_service), Udp_acceptor<>(io_service) {}
+    ~Udp_connector_and_acceptor() {
+        for (auto it = m_connections.begin(); it != m_connections.end(); ++it) {
+            delete *it;
+        }
+    }
+
+    //called for every connection created by udp_connect and for every new peer that sends us a datagram
+    void accepted(Connection* connection) {
+        m_connections.insert(connection);
+        std::cout << "New peer: " << static_cast<Udp_connection*>(connection)->peer() << std::endl;
+        std::string hello_message = "hello";
+        connection->write(hello_message.c_str(), hello_message.length());
+    }
+
+    void error(Connection* connection, const system::error_code& error_code) {
+        std::cout << "Connection error: " << error_code.message() << std::endl;
+        delete connection;
+        m_connections.erase(connection);
+    }
+
+    void error(const system::error_code& error_code) {
+        std::cout << "Received error: " << error_code.message() << std::endl;
+    }
+
+    void received(Connection* connection, const char* data, int size) {
+        std::string message(data, size);
+        std::cout << "Received datagram: " << message << std::endl;
+        if (message == "hello") {
+            std::string reply = "hello yourself";
+            connection->write(reply.c_str(), reply.length());
+        }
+    }
+
+    std::set<Connection*> m_connections;
+};
+
+int main() {
+    boost::asio::io_service io_service;
+    Udp_connector_and_acceptor connector_and_acceptor(io_service);
+    connector_and_acceptor.udp_accept(6000);
+    connector_and_acceptor.udp_accept(6001);
+    connector_and_acceptor.udp_connect("127.0.0.1", 6000);
+    connector_and_acceptor.udp_connect("127.0.0.1", 6001);
+    //run all events for more or less 1 second
+    for (int i = 0; i < 1000; i++) {
+        io_service.poll();
+        usleep(1000);
+    }
+    return 0;
+}
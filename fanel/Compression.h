@@ -0,0 +1,216 @@
+#ifndef FANEL_COMPRESSION_H
+#define FANEL_COMPRESSION_H
+
+//Compression of messages, used by Socket_connection when compiled with USE_ZSTD and/or USE_ZLIB
+
+#include <cstddef>
+#include <cstring>
+
+#ifdef USE_ZSTD
+    #include <zstd.h>
+#endif
+
+#ifdef USE_ZLIB
+    #include <zlib.h>
+#endif
+
+//codec ids as they appear on the network
+#define ZLIB_CODEC 1
+#define ZSTD_CODEC 2
+
+//Lower is faster, higher compresses better. The default favours speed for both codecs.
+#ifndef COMPRESSION_LEVEL
+    #define COMPRESSION_LEVEL 1
+#endif
+
+/** \brief Compresses the messages written to one connection.
+ *
+ * The codec keeps its state between messages and every message is flushed, not ended.
+ * Later messages can refer back to the data of earlier ones, so the history works as a
+ * dictionary that is built on the fly and small repetitive messages compress well too.
+ * The flip side is that every compressed message has to be sent, and decompressed, in
+ * the order it was compressed in.
+ *
+ * zstd is used if available, it is faster and compresses better than zlib.
+ */
+class Message_compressor {
+  public:
+    Message_compressor();
+    ~Message_compressor();
+
+    //the codec id to put on the network
+    unsigned char codec() const;
+    //the largest possible compressed size of size bytes
+    size_t bound(size_t size) const;
+    //compresses size bytes of data into out, which must hold bound(size) bytes
+    //returns the compressed size or 0 on failure, after which the compressor is unusable
+    size_t compress(const char* data, size_t size, char* out);
+
+  private:
+    Message_compressor(const Message_compressor&);
+    Message_compressor& operator=(const Message_compressor&);
+
+    #ifdef USE_ZSTD
+        ZSTD_CCtx* context;
+    #else
+        z_stream stream;
+    #endif
+};
+
+/** \brief Decompresses the messages received on one connection.
+ *
+ * Every codec we are compiled with is understood, whatever codec the other side prefers.
+ */
+class Message_decompressor {
+  public:
+    Message_decompressor();
+    ~Message_decompressor();
+
+    //true if we can decompress the given codec
+    static bool supports(unsigned char codec);
+    //decompresses compressed_size bytes of data into out, which must be exactly size bytes
+    //returns false if the data is corrupt, after which the decompressor is unusable
+    bool decompress(unsigned char codec, const char* data, size_t compressed_size, char* out, size_t size);
+
+  private:
+    Message_decompressor(const Message_decompressor&);
+    Message_decompressor& operator=(const Message_decompressor&);
+
+    #ifdef USE_ZSTD
+        ZSTD_DCtx* zstd_context;
+    #endif
+    #ifdef USE_ZLIB
+        z_stream zlib_stream;
+    #endif
+};
+
+//implementation
+
+inline Message_compressor::Message_compressor() {
+    #ifdef USE_ZSTD
+        context = ZSTD_createCCtx();
+        ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, COMPRESSION_LEVEL);
+    #else
+        //raw deflate, the messages are framed already so we need no zlib header or checksum
+        memset(&stream, 0, sizeof(stream));
+        deflateInit2(&stream, COMPRESSION_LEVEL, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    #endif
+}
+
+inline Message_compressor::~Message_compressor() {
+    #ifdef USE_ZSTD
+        ZSTD_freeCCtx(context);
+    #else
+        deflateEnd(&stream);
+    #endif
+}
+
+inline unsigned char Message_compressor::codec() const {
+    #ifdef USE_ZSTD
+        return ZSTD_CODEC;
+    #else
+        return ZLIB_CODEC;
+    #endif
+}
+
+inline size_t Message_compressor::bound(size_t size) const {
+    #ifdef USE_ZSTD
+        return ZSTD_compressBound(size);
+    #else
+        //deflateBound does not count the empty block a sync flush adds
+        return deflateBound(const_cast<z_stream*>(&stream), size) + 16;
+    #endif
+}
+
+inline size_t Message_compressor::compress(const char* data, size_t size, char* out) {
+    #ifdef USE_ZSTD
+        ZSTD_inBuffer input = { data, size, 0 };
+        ZSTD_outBuffer output = { out, bound(size), 0 };
+        size_t remaining;
+        do {
+            remaining = ZSTD_compressStream2(context, &output, &input, ZSTD_e_flush);
+            if (ZSTD_isError(remaining)) return 0;
+        } while (remaining != 0 && output.pos < output.size);
+        return remaining == 0 ? output.pos : 0;
+    #else
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef*)out;
+        stream.avail_out = bound(size);
+        if (deflate(&stream, Z_SYNC_FLUSH) != Z_OK || stream.avail_in != 0) return 0;
+        return (char*)stream.next_out - out;
+    #endif
+}
+
+inline Message_decompressor::Message_decompressor() {
+    #ifdef USE_ZSTD
+        zstd_context = ZSTD_createDCtx();
+    #endif
+    #ifdef USE_ZLIB
+        memset(&zlib_stream, 0, sizeof(zlib_stream));
+        inflateInit2(&zlib_stream, -15);
+    #endif
+}
+
+inline Message_decompressor::~Message_decompressor() {
+    #ifdef USE_ZSTD
+        ZSTD_freeDCtx(zstd_context);
+    #endif
+    #ifdef USE_ZLIB
+        inflateEnd(&zlib_stream);
+    #endif
+}
+
+inline bool Message_decompressor::supports(unsigned char codec) {
+    #ifdef USE_ZSTD
+        if (codec == ZSTD_CODEC) return true;
+    #endif
+    #ifdef USE_ZLIB
+        if (codec == ZLIB_CODEC) return true;
+    #endif
+    return false;
+}
+
+inline bool Message_decompressor::decompress(unsigned char codec, const char* data, size_t compressed_size, char* out, size_t size) {
+    #ifdef USE_ZSTD
+        if (codec == ZSTD_CODEC) {
+            ZSTD_inBuffer input = { data, compressed_size, 0 };
+            ZSTD_outBuffer output = { out, size, 0 };
+            while (input.pos < input.size) {
+                size_t result = ZSTD_decompressStream(zstd_context, &output, &input);
+                if (ZSTD_isError(result)) return false;
+                if (output.pos == output.size && input.pos < input.size) {
+                    //only block headers can be left, anything more and the message is larger than announced
+                    char extra;
+                    ZSTD_outBuffer overflow = { &extra, 1, 0 };
+                    result = ZSTD_decompressStream(zstd_context, &overflow, &input);
+                    if (ZSTD_isError(result) || overflow.pos != 0) return false;
+                    break;
+                }
+            }
+            return input.pos == input.size && output.pos == size;
+        }
+    #endif
+    #ifdef USE_ZLIB
+        if (codec == ZLIB_CODEC) {
+            zlib_stream.next_in = (Bytef*)data;
+            zlib_stream.avail_in = compressed_size;
+            zlib_stream.next_out = (Bytef*)out;
+            zlib_stream.avail_out = size;
+            int result = inflate(&zlib_stream, Z_SYNC_FLUSH);
+            if ((result != Z_OK && result != Z_BUF_ERROR) || zlib_stream.avail_out != 0) return false;
+            if (zlib_stream.avail_in != 0) {
+                //the empty block of the sync flush can still be waiting for room that it does not need
+                char extra;
+                zlib_stream.next_out = (Bytef*)&extra;
+                zlib_stream.avail_out = 1;
+                result = inflate(&zlib_stream, Z_SYNC_FLUSH);
+                if ((result != Z_OK && result != Z_BUF_ERROR) || zlib_stream.avail_out != 1) return false;
+            }
+            return zlib_stream.avail_in == 0;
+        }
+    #endif
+    return false;
+}
+
+#endif //FANEL_COMPRESSION_H
@@ -2,7 +2,9 @@
 #define FANEL_CONNECTION_H
 
 #include <cstddef>
+#include <sys/types.h>
 #include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include "Connection_manager.h"
 
 using namespace boost;
@@ -17,6 +19,12 @@ class Connection {
     virtual void start() = 0;
     //write data
     virtual void write(const char* data, size_t size) = 0;
+    //write data in a priority lane, higher lanes go first. Connections without lanes write it like any other message.
+    virtual void write(const char* data, size_t size, int priority) = 0;
+    //write size bytes of the file fd starting at offset, in order with the other writes
+    virtual void write_file(int fd, off_t offset, size_t size) = 0;
+    //finish the queued writes, then call drained on the connection manager
+    virtual void drain(boost::posix_time::time_duration timeout) = 0;
     
   protected:
     #ifdef USE_CONNECTION_RECEIVE_OVERIDE
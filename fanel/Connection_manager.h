@@ -18,6 +18,8 @@ class Connection_manager {
     virtual void received(Connection* connection, const char* data, int size) = 0;
     ///overload to receive a notice when a connection is done writing
     virtual void write_done(Connection* connection) {};
+    ///overload to receive a notice when a drain finished, error is asio::error::timed_out if the queued writes did not make the deadline
+    virtual void drained(Connection* connection, const boost::system::error_code& error) {}
 };
 
 #endif //FANEL_CONNECTION_MANAGER_H
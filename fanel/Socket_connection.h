@@ -7,6 +7,7 @@
 #include "copyable_unique_ptr.h"
 
 #include <deque>
+#include <vector>
 #include <boost/asio.hpp>
 #include <memory>
 
@@ -18,6 +19,28 @@
     #include <boost/asio/ssl.hpp>
 #endif
 
+#if defined(USE_ZSTD) || defined(USE_ZLIB)
+    #if defined(DELIMITER) || defined(NETSTRING) || defined(STREAMING)
+        #error "Compression needs the default size prefix framing"
+    #endif
+    #define USE_COMPRESSION
+    #include "Compression.h"
+#endif
+
+//every lane has its own write queue, see write(data, size, priority)
+#ifdef WRITE_PRIORITIES
+    #if WRITE_PRIORITIES < 1 || WRITE_PRIORITIES > 16
+        #error "WRITE_PRIORITIES must be between 1 and 16"
+    #endif
+    #define WRITE_LANES WRITE_PRIORITIES
+    //with size prefix framing, large messages are sent in chunks so other lanes can go in between
+    #if !defined(DELIMITER) && !defined(NETSTRING) && !defined(STREAMING)
+        #define CHUNKED_WRITES
+    #endif
+#else
+    #define WRITE_LANES 1
+#endif
+
 using namespace boost;
 
 #define MAX_MESSAGE_SIZE_EXCEEDED 1
@@ -25,6 +48,14 @@ using namespace boost;
     #define NETSTRING_MALFORMED_HEADER 2
     #define NETSTRING_DELIMITER_NOT_FOUND 3
 #endif
+#ifdef USE_COMPRESSION
+    #define COMPRESSION_FAILED 4
+    #define UNSUPPORTED_CODEC 5
+    #define DECOMPRESSION_FAILED 6
+#endif
+#ifdef CHUNKED_WRITES
+    #define MALFORMED_CHUNK 7
+#endif
 class custom_network_error_category : public boost::system::error_category {
 public:
   const char *name() const { return "custom_network_error"; }
@@ -36,6 +67,14 @@ public:
             case NETSTRING_MALFORMED_HEADER: return "Malformed netstringheader";
             case NETSTRING_DELIMITER_NOT_FOUND: return "Netstring Delimiter not found";
         #endif
+        #ifdef USE_COMPRESSION
+            case COMPRESSION_FAILED: return "Compression failed";
+            case UNSUPPORTED_CODEC: return "Message compressed with an unsupported codec";
+            case DECOMPRESSION_FAILED: return "Decompression failed";
+        #endif
+        #ifdef CHUNKED_WRITES
+            case MALFORMED_CHUNK: return "Chunks do not add up to a message";
+        #endif
         default: return "Inkown error";
     }
   }
@@ -53,6 +92,20 @@ public:
  * Messages are passed over the network preceded by their size as a 4 byte unsigned integer 
  * encoded in network byte order (big endian), htonl/ntohl are used for platform independent 
  * encoding and decoding of this integer.
+ *
+ * Compiled with USE_ZSTD or USE_ZLIB, messages of COMPRESSION_THRESHOLD bytes or more are
+ * compressed. The highest bit of the size marks a compressed message, its body is a 1 byte
+ * codec id, the uncompressed size as a 4 byte integer and the compressed data. Messages are
+ * decompressed before they are passed to received.
+ *
+ * Writes are gathered: every write takes as many queued messages as it can with a single
+ * system call. With a WRITE_BUDGET a write takes at most that many bytes and the next turn
+ * is posted to the io_service, so other connections get their turn in between. Compiled
+ * with WRITE_PRIORITIES, which implies a budget, messages are queued in lanes and higher
+ * lanes are written first. Under size prefix framing, messages larger than WRITE_CHUNK_SIZE
+ * are then sent in chunks, with messages of higher lanes in between. A chunk has the second highest bit of its size set, the third if it
+ * is the last chunk, the lane in bits 24 to 27 and its size in the lower 24 bits. The
+ * chunks of a message together form the frame the message would have had unchunked.
  */
 
 template<class SocketType>
@@ -60,8 +113,14 @@ class Socket_connection : public Connection {
   static custom_network_error_category cat;
 
   struct Buffer {
-      char* data;
+      Buffer() : data(0), size(0), sent(0), framed(false), fd(-1), offset(0) {}
+      const char* data;
       size_t size;
+      size_t sent; //bytes of data already written, only chunks leave a buffer partly written
+      bool framed; //a message from write, as opposed to write_raw or write_file
+      std::shared_ptr<const std::string> shared; //when set, data points into it and must not be freed
+      int fd; //when set, size bytes of this file starting at offset are written instead of data
+      off_t offset;
   };
 
   public:
@@ -81,11 +140,44 @@ class Socket_connection : public Connection {
     void start();
     //write data
     void write(const char* data, size_t size);
+    //write data in the given lane, from 0 to WRITE_PRIORITIES - 1. Higher lanes are written first,
+    //write(data, size) uses lane 0. Messages are received in order within a lane, not across lanes.
+    //Without WRITE_PRIORITIES there is only lane 0.
+    void write(const char* data, size_t size, int priority);
+    //write data as is, without framing. Nothing is copied, the connection keeps a reference
+    //until the data is written. Only useful to talk protocols the peer frames itself.
+    void write_raw(std::shared_ptr<const std::string> data);
+    //write size bytes of the file fd starting at offset, without framing, in order with the other writes.
+    //Without ssl on linux this uses sendfile, so the file never passes through user space. The descriptor
+    //is duplicated, you can close yours right away.
+    void write_file(int fd, off_t offset, size_t size);
+    //finish the writes that are queued and stop writing. Once the queue is flushed the sending side of the
+    //socket is shut down, so the peer reads the end of the stream after the last message, and drained is
+    //called. If that takes longer than timeout, drained is called with asio::error::timed_out instead and
+    //the queue is left as it is. Either way reading goes on until you delete the connection.
+    void drain(boost::posix_time::time_duration timeout);
+    //keep TCP_QUICKACK on by setting it again after every read, the acceptors and connectors
+    //call this with Socket_options::quick_ack
+    void set_quick_ack(bool on);
+    #ifdef DELIMITER
+        //the next size bytes are passed to received as one message, whether they contain the delimiter or not.
+        //Call this from received to read a body of known length that follows a delimited header.
+        void read_raw(size_t size);
+    #endif
 
   private:
 
+    void write_in_lane(const char* data, size_t size, int lane);
+    void queue_write(const Buffer& buffer, int lane = 0);
     void start_write();
+    void handle_start_write(std::weak_ptr<bool> alive);
     void handle_write(const system::error_code& error, std::weak_ptr<bool> alive);
+    void handle_write_file(const system::error_code& error, std::weak_ptr<bool> alive);
+    static void release(Buffer& buffer);
+    void handle_error(const system::error_code& error, std::weak_ptr<bool> alive);
+    void finish_drain(const system::error_code& error, std::weak_ptr<bool> alive);
+    void handle_drain_timeout(const system::error_code& error, std::weak_ptr<bool> alive);
+    void rearm_quick_ack();
     
     #ifdef DELIMITER
         void start_read();
@@ -94,6 +186,13 @@ class Socket_connection : public Connection {
         size_t read_buffer_size;
         size_t delimiter_progress;
         char* message_start;
+        size_t raw_size;
+        //the KMP prefix function of the delimiter, see delimiter_restart()
+        struct Delimiter_restart {
+            Delimiter_restart();
+            size_t table[sizeof(DELIMITER)-1];
+        };
+        static const size_t* delimiter_restart();
     #elif NETSTRING
         void start_read_header();
         void handle_read_header(const system::error_code& error, std::size_t bytes_transferred, std::weak_ptr<bool> alive);
@@ -107,11 +206,47 @@ class Socket_connection : public Connection {
         void start_read_header();
         void handle_read_header(const system::error_code& error, std::weak_ptr<bool> alive);
         void handle_read_body(size_t size, const system::error_code& error, std::weak_ptr<bool> alive);
+        bool deliver(const char* body, size_t size, bool compressed, std::weak_ptr<bool> alive);
+        #ifdef CHUNKED_WRITES
+            void start_read_chunk(uint32_t header);
+            void handle_read_chunk(uint32_t header, const system::error_code& error, std::weak_ptr<bool> alive);
+            std::vector<char> partial_messages[16]; //the chunks received so far, per lane of the peer
+        #endif
     #endif
 
+    #ifdef USE_COMPRESSION
+        bool write_compressed(const char* data, size_t size, int lane);
+        //created with the first compressed message, most connections never need them. Lanes are
+        //received in a different order than they are written, so every lane has its own codec stream.
+        std::unique_ptr<Message_compressor> compressors[WRITE_LANES];
+        std::unique_ptr<Message_decompressor> decompressors[16];
+        bool read_compressed;
+        #ifdef THREADSAFE
+            //held from compressing a message until it is queued, so messages are queued in the order the codec saw them
+            boost::mutex compressor_mutex;
+        #endif
+    #endif
+
+    asio::io_service& io_service;
     SocketType socket_;
     char* m_readbuf;
-    std::deque<Buffer> write_queue;
+    std::deque<Buffer> write_queue[WRITE_LANES];
+    bool writing; //guarded by write_queue_mutex, true from the first queued buffer until the queues are empty
+
+    //the pieces of the write in flight, only touched by the writer
+    struct Piece {
+        int lane;
+        bool last; //the piece completes the front buffer of its lane
+    };
+    static const size_t max_pieces = 64;
+    Piece pieces[max_pieces];
+    size_t piece_count;
+    uint32_t chunk_headers[max_pieces];
+    std::vector<asio::const_buffer> gather;
+
+    bool draining; //guarded by write_queue_mutex
+    asio::deadline_timer drain_timer;
+    bool quick_ack;
 	std::shared_ptr<bool> still_alive;
 
     #ifdef THREADSAFE
@@ -0,0 +1,126 @@
+#ifndef FANEL_SOCKET_OPTIONS_H
+#define FANEL_SOCKET_OPTIONS_H
+
+//Socket tuning for the acceptors and connectors, see "Socket options" in the README
+
+#include <boost/asio.hpp>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+
+#ifdef __linux__
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+/** \brief Options for the sockets of an acceptor or connector.
+ *
+ * Pass it to accept()/connect(). The options are set on every socket before it is
+ * handed to the connection, so they are in place before the first byte is read or
+ * written. Everything is off by default, which leaves the kernel defaults alone.
+ *
+ * quick_ack, busy_poll and defer_accept only exist on linux, asking for them
+ * elsewhere reports operation_not_supported.
+ */
+struct Socket_options {
+    Socket_options()
+        :tcp_nodelay(false)
+        ,send_buffer_size(0)
+        ,receive_buffer_size(0)
+        ,quick_ack(false)
+        ,busy_poll(0)
+        ,defer_accept(0)
+        ,listen_backlog(0)
+    {}
+
+    //send small messages right away instead of waiting to fill a segment (TCP_NODELAY)
+    bool tcp_nodelay;
+    //kernel buffer sizes in bytes (SO_SNDBUF/SO_RCVBUF). The kernel doubles them for its bookkeeping.
+    int send_buffer_size;
+    int receive_buffer_size;
+    //acknowledge received data right away instead of delaying the ack (TCP_QUICKACK). The kernel
+    //drops it after a while, so the connection sets it again after every read.
+    bool quick_ack;
+    //microseconds to busy poll the device queue on a blocking read (SO_BUSY_POLL)
+    int busy_poll;
+    //only used by acceptors, seconds to wait for the first data before a connection is accepted (TCP_DEFER_ACCEPT)
+    int defer_accept;
+    //only used by acceptors, the length of the queue of connections waiting to be accepted
+    int listen_backlog;
+
+    //set the options on a connection socket, before it connects or right after it is accepted
+    template <class Socket>
+    void apply(Socket& socket, boost::system::error_code& error_code) const;
+    //set the options on a listening socket, before it listens
+    void apply_listener(boost::asio::ip::tcp::acceptor& acceptor, boost::system::error_code& error_code) const;
+    //the backlog to pass to listen
+    int backlog() const { return listen_backlog > 0 ? listen_backlog : (int)boost::asio::socket_base::max_connections; }
+
+  private:
+    static void set_int(int handle, int level, int name, int value, boost::system::error_code& error_code);
+};
+
+//pin the calling thread to the given cpu, call it from the threads that run the io_service
+inline boost::system::error_code pin_thread(int cpu) {
+    #ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        return boost::system::error_code(result, boost::asio::error::get_system_category());
+    #else
+        return boost::asio::error::operation_not_supported;
+    #endif
+}
+
+//implementation
+
+template <class Socket>
+void Socket_options::apply(Socket& socket, boost::system::error_code& error_code) const {
+    error_code = boost::system::error_code();
+    if (tcp_nodelay)
+        socket.set_option(boost::asio::ip::tcp::no_delay(true), error_code);
+    if (!error_code && send_buffer_size > 0)
+        socket.set_option(boost::asio::socket_base::send_buffer_size(send_buffer_size), error_code);
+    if (!error_code && receive_buffer_size > 0)
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer_size), error_code);
+    if (!error_code && quick_ack) {
+        #ifdef TCP_QUICKACK
+            set_int(socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, 1, error_code);
+        #else
+            error_code = boost::asio::error::operation_not_supported;
+        #endif
+    }
+    if (!error_code && busy_poll > 0) {
+        #ifdef SO_BUSY_POLL
+            set_int(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, busy_poll, error_code);
+        #else
+            error_code = boost::asio::error::operation_not_supported;
+        #endif
+    }
+}
+
+inline void Socket_options::apply_listener(boost::asio::ip::tcp::acceptor& acceptor, boost::system::error_code& error_code) const {
+    error_code = boost::system::error_code();
+    //accepted sockets inherit the buffer sizes, and the receive buffer has to be set before
+    //listen for the window scale the kernel offers in the handshake to match it
+    if (send_buffer_size > 0)
+        acceptor.set_option(boost::asio::socket_base::send_buffer_size(send_buffer_size), error_code);
+    if (!error_code && receive_buffer_size > 0)
+        acceptor.set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer_size), error_code);
+    if (!error_code && defer_accept > 0) {
+        #ifdef TCP_DEFER_ACCEPT
+            set_int(acceptor.native_handle(), IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept, error_code);
+        #else
+            error_code = boost::asio::error::operation_not_supported;
+        #endif
+    }
+}
+
+inline void Socket_options::set_int(int handle, int level, int name, int value, boost::system::error_code& error_code) {
+    if (setsockopt(handle, level, name, &value, sizeof(value)) != 0)
+        error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+}
+
+#endif //FANEL_SOCKET_OPTIONS_H
@@ -0,0 +1,124 @@
+#ifndef FANEL_UDP_ACCEPTOR_H
+#define FANEL_UDP_ACCEPTOR_H
+
+#include "Connection_manager.h"
+#include "Udp_connection.h"
+
+#include <map>
+#include <memory>
+#include <iostream>
+#include <functional>
+
+/** \brief Receives datagrams on one or more ports.
+ *
+ * After initialisation, call udp_accept(port number) to start receiving. Every remote
+ * endpoint that sends a datagram to the port generates a new Udp_connection that
+ * is passed to accepted(), after which its datagrams are passed to received().
+ *
+ * The template parameter is the connection type the class should create and should
+ * either be Udp_connection or descend from it.
+ */
+
+template <class Connection_type = Udp_connection>
+class Udp_acceptor : public virtual Connection_manager {
+  public:
+    Udp_acceptor(boost::asio::io_service& io_service);
+    ~Udp_acceptor();
+
+    ///start receiving datagrams on the given port
+    void udp_accept(int port);
+
+    ///stop generating connections for new peers on the given port, existing connections keep working
+    void udp_stop_accept(int port);
+
+  private:
+    Udp_connection* create_connection(std::shared_ptr<Udp_socket> socket, const boost::asio::ip::udp::endpoint& peer);
+
+    std::map<int, std::shared_ptr<Udp_socket> > udp_sockets;
+
+    #ifdef THREADSAFE
+        boost::mutex udp_sockets_mutex;
+    #endif
+
+    boost::asio::io_service& io_service;
+};
+
+//implementation
+template <class Connection_type>
+Udp_acceptor<Connection_type>::Udp_acceptor(boost::asio::io_service& io_service_)
+  : io_service(io_service_)
+{}
+
+template <class Connection_type>
+Udp_acceptor<Connection_type>::~Udp_acceptor() {
+    #ifdef THREADSAFE
+        boost::lock_guard<boost::mutex> lock(udp_sockets_mutex);
+    #endif
+    //sockets can outlive us through their connections, they must not call back into a deleted acceptor
+    for (auto it = udp_sockets.begin(); it != udp_sockets.end(); ++it) {
+        it->second->stop_accept();
+    }
+}
+
+template <class Connection_type>
+void Udp_acceptor<Connection_type>::udp_accept(int port) {
+    std::shared_ptr<Udp_socket> udp_socket(new Udp_socket(io_service, *this));
+    {
+        #ifdef THREADSAFE
+            boost::lock_guard<boost::mutex> lock(udp_sockets_mutex);
+        #endif
+        if (udp_sockets.find(port) != udp_sockets.end()) {
+            std::cerr << "Duplicated bind on port " << port << ", ignored." << std::endl;
+            return;
+        }
+        udp_sockets[port] = udp_socket;
+    }
+
+    //a dual stack socket receives both ipv6 and ipv4 datagrams, without ipv6 we fall back to ipv4
+    boost::asio::ip::udp::socket& socket = udp_socket->socket();
+    boost::asio::ip::udp::endpoint endpoint(boost::asio::ip::udp::v6(), port);
+    boost::system::error_code error_code;
+    socket.open(endpoint.protocol(), error_code);
+    if (!error_code)
+        socket.set_option(boost::asio::ip::v6_only(false), error_code);
+    if (error_code) {
+        boost::system::error_code ignored;
+        socket.close(ignored);
+        endpoint = boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port);
+        error_code = boost::system::error_code();
+        socket.open(endpoint.protocol(), error_code);
+    }
+    if (!error_code)
+        socket.bind(endpoint, error_code);
+    if (error_code) {
+        udp_stop_accept(port);
+        error(error_code);
+        return;
+    }
+    udp_socket->start(std::bind(&Udp_acceptor::create_connection, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+template <class Connection_type>
+void Udp_acceptor<Connection_type>::udp_stop_accept(int port) {
+    std::shared_ptr<Udp_socket> old_socket;
+    {
+        #ifdef THREADSAFE
+            boost::lock_guard<boost::mutex> lock(udp_sockets_mutex);
+        #endif
+        auto socket_it = udp_sockets.find(port);
+        if (socket_it == udp_sockets.end()) {
+            std::cerr << "Stopping accept on port " << port << ", but it was not bound." << std::endl;
+            return;
+        }
+        old_socket = socket_it->second;
+        udp_sockets.erase(socket_it);
+    }
+    old_socket->stop_accept(); //the socket closes as soon as its last connection is deleted
+}
+
+template <class Connection_type>
+Udp_connection* Udp_acceptor<Connection_type>::create_connection(std::shared_ptr<Udp_socket> socket, const boost::asio::ip::udp::endpoint& peer) {
+    return new Connection_type(socket, peer, *this);
+}
+
+#endif //FANEL_UDP_ACCEPTOR_H
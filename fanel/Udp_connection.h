@@ -0,0 +1,127 @@
+#ifndef FANEL_UDP_CONNECTION_H
+#define FANEL_UDP_CONNECTION_H
+
+#include "Connection.h"
+#include "Udp_socket.h"
+
+#include <memory>
+#include <cstdlib>
+#include <cstring>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+/** \brief A pseudo-connection to a single udp peer.
+ *
+ * Udp_connections are generated by Udp_acceptor (one for every new remote endpoint
+ * that sends a datagram) or by Udp_connector. They share the interface of the tcp
+ * connections, so the same Connection_manager callbacks receive their data.
+ *
+ * Every write is sent as exactly one datagram and every received datagram is passed
+ * as one message to received. There is no framing, but also none of the guarantees
+ * tcp gives you: datagrams can be lost, duplicated or arrive out of order, and they
+ * can not be larger than MAX_DATAGRAM_SIZE.
+ *
+ * You own the connection, deleting it stops receiving from the peer. Datagrams of a
+ * deleted peer will generate a new connection if the acceptor is still accepting.
+ */
+
+class Udp_connection : public Connection {
+  friend class Udp_socket;
+
+  public:
+    Udp_connection(std::shared_ptr<Udp_socket> socket, const boost::asio::ip::udp::endpoint& peer, Connection_manager& manager);
+    virtual ~Udp_connection();
+
+    ///the underlying socket, it is shared with all other connections on the same port
+    boost::asio::ip::udp::socket& socket();
+    const boost::asio::ip::udp::endpoint& peer() const;
+
+    //the shared socket is always reading, nothing to do
+    void start();
+    //write data as a single datagram
+    void write(const char* data, size_t size);
+    //datagrams have no lanes, the same as write(data, size)
+    void write(const char* data, size_t size, int priority);
+    //not supported, reports asio::error::operation_not_supported on the connection
+    void write_file(int fd, off_t offset, size_t size);
+    //not supported, drained is called with asio::error::operation_not_supported
+    void drain(boost::posix_time::time_duration timeout);
+
+  private:
+    void handle_error(const system::error_code& error_code, std::weak_ptr<bool> alive);
+    void handle_drain(std::weak_ptr<bool> alive);
+
+    std::shared_ptr<Udp_socket> socket_;
+    boost::asio::ip::udp::endpoint peer_;
+    size_t pending_writes; //guarded by the send queue of the socket
+    std::shared_ptr<bool> still_alive;
+};
+
+//implementation
+
+inline Udp_connection::Udp_connection(std::shared_ptr<Udp_socket> socket, const boost::asio::ip::udp::endpoint& peer, Connection_manager& manager)
+    :Connection(manager)
+    ,socket_(socket)
+    ,peer_(peer)
+    ,pending_writes(0)
+    ,still_alive(new bool(true))
+{
+    socket_->attach(this);
+}
+
+inline Udp_connection::~Udp_connection() {
+    socket_->detach(this);
+}
+
+inline boost::asio::ip::udp::socket& Udp_connection::socket() {
+    return socket_->socket();
+}
+
+inline const boost::asio::ip::udp::endpoint& Udp_connection::peer() const {
+    return peer_;
+}
+
+inline void Udp_connection::start() {}
+
+inline void Udp_connection::write(const char* data, size_t size) {
+    if (size > MAX_DATAGRAM_SIZE) {
+        //report asynchronously, like every other error, so the callback can safely delete us
+        socket_->get_io_service().post(boost::bind(&Udp_connection::handle_error, this,
+            system::error_code(boost::asio::error::message_size),
+            std::weak_ptr<bool>(still_alive)));
+        return;
+    }
+    char* buffer = (char*)malloc(size);
+    memcpy(buffer, data, size);
+    socket_->send(this, buffer, size);
+}
+
+inline void Udp_connection::write(const char* data, size_t size, int priority) {
+    write(data, size);
+}
+
+inline void Udp_connection::write_file(int fd, off_t offset, size_t size) {
+    socket_->get_io_service().post(boost::bind(&Udp_connection::handle_error, this,
+        system::error_code(boost::asio::error::operation_not_supported),
+        std::weak_ptr<bool>(still_alive)));
+}
+
+inline void Udp_connection::drain(boost::posix_time::time_duration timeout) {
+    //drained is never called from within drain, so it can delete us
+    socket_->get_io_service().post(boost::bind(&Udp_connection::handle_drain, this,
+        std::weak_ptr<bool>(still_alive)));
+}
+
+inline void Udp_connection::handle_drain(std::weak_ptr<bool> alive) {
+    if (alive.expired()) return;
+    connection_manager.drained(this, boost::asio::error::operation_not_supported);
+}
+
+inline void Udp_connection::handle_error(const system::error_code& error_code, std::weak_ptr<bool> alive) {
+    if (alive.expired()) return;
+    error(error_code);
+}
+
+#include "Udp_socket.impl"
+
+#endif //FANEL_UDP_CONNECTION_H
@@ -0,0 +1,151 @@
+#ifndef FANEL_UDP_CONNECTOR_H
+#define FANEL_UDP_CONNECTOR_H
+
+#include "Connection_manager.h"
+#include "Udp_connection.h"
+
+#include <map>
+#include <memory>
+#include <iostream>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+/** \brief Creates udp connections to one or more servers.
+ *
+ * After initialisation, call udp_connect(server, port). Once the server name is
+ * resolved a connection is passed to accepted(). Every connection gets its own
+ * connected socket, so only datagrams from that server will reach it.
+ *
+ * Udp has no handshake, so a connection does not mean anyone is listening. If
+ * nobody is, the platform might report connection refused on the connection
+ * after the first write.
+ */
+
+template <class Connection_type = Udp_connection>
+class Udp_connector : public virtual Connection_manager {
+  public:
+    Udp_connector(boost::asio::io_service& io_service);
+    ~Udp_connector();
+
+    ///create a connection to the given server and port
+    void udp_connect(const std::string& server, const int port);
+
+    ///stop a connect in progress, established connections are not affected
+    void udp_stop_connect(const std::string& server, const int port);
+
+  private:
+    typedef std::pair<std::string, int> Key;
+
+    void handle_resolve(Key key, const boost::system::error_code& error_code, boost::asio::ip::udp::resolver::iterator endpoint_iterator, std::weak_ptr<bool> alive);
+
+    std::map<Key, boost::asio::ip::udp::resolver*> resolvers;
+
+    #ifdef THREADSAFE
+        boost::mutex resolvers_mutex;
+    #endif
+
+    boost::asio::io_service& io_service;
+    std::shared_ptr<bool> still_alive;
+};
+
+//implementation
+template <class Connection_type>
+Udp_connector<Connection_type>::Udp_connector(boost::asio::io_service& io_service_)
+  : io_service(io_service_)
+  , still_alive(new bool(true))
+{}
+
+template <class Connection_type>
+Udp_connector<Connection_type>::~Udp_connector() {
+    #ifdef THREADSAFE
+        boost::lock_guard<boost::mutex> lock(resolvers_mutex);
+    #endif
+    for (auto it = resolvers.begin(); it != resolvers.end(); ++it) {
+        it->second->cancel();
+        delete it->second;
+    }
+}
+
+template <class Connection_type>
+void Udp_connector<Connection_type>::udp_connect(const std::string& server, const int port) {
+    Key key = std::make_pair(server, port);
+    boost::asio::ip::udp::resolver* resolver = new boost::asio::ip::udp::resolver(io_service);
+    {
+        #ifdef THREADSAFE
+            boost::lock_guard<boost::mutex> lock(resolvers_mutex);
+        #endif
+        if (resolvers.find(key) != resolvers.end()) {
+            delete resolver;
+            std::cerr << "Duplicated connect to " << server << ":" << port << ", ignored." << std::endl;
+            return;
+        }
+        resolvers[key] = resolver;
+    }
+    boost::asio::ip::udp::resolver::query query(server, boost::lexical_cast<std::string>(port));
+    resolver->async_resolve(query,
+        boost::bind(&Udp_connector::handle_resolve, this, key,
+            boost::asio::placeholders::error,
+            boost::asio::placeholders::iterator,
+            std::weak_ptr<bool>(still_alive)));
+}
+
+template <class Connection_type>
+void Udp_connector<Connection_type>::udp_stop_connect(const std::string& server, const int port) {
+    boost::asio::ip::udp::resolver* old_resolver;
+    {
+        #ifdef THREADSAFE
+            boost::lock_guard<boost::mutex> lock(resolvers_mutex);
+        #endif
+        auto resolver_it = resolvers.find(std::make_pair(server, port));
+        if (resolver_it == resolvers.end()) {
+            std::cerr << "Stopping connect to " << server << ":" << port << ", but no connect was in progress." << std::endl;
+            return;
+        }
+        old_resolver = resolver_it->second;
+        resolvers.erase(resolver_it);
+    }
+    old_resolver->cancel();
+    delete old_resolver;
+}
+
+template <class Connection_type>
+void Udp_connector<Connection_type>::handle_resolve(Key key, const boost::system::error_code& error_code, boost::asio::ip::udp::resolver::iterator endpoint_iterator, std::weak_ptr<bool> alive) {
+    if (alive.expired()) return;
+    boost::asio::ip::udp::resolver* resolver = 0;
+    {
+        #ifdef THREADSAFE
+            boost::lock_guard<boost::mutex> lock(resolvers_mutex);
+        #endif
+        auto resolver_it = resolvers.find(key);
+        if (resolver_it == resolvers.end()) return; //stopped
+        resolver = resolver_it->second;
+        resolvers.erase(resolver_it);
+    }
+    delete resolver;
+
+    if (error_code) {
+        error(error_code);
+        return;
+    }
+
+    //connecting a udp socket does not send anything, it only fixes the peer, so the first endpoint that opens will do
+    boost::system::error_code connect_error = boost::asio::error::host_not_found;
+    boost::asio::ip::udp::resolver::iterator end;
+    for (; endpoint_iterator != end; ++endpoint_iterator) {
+        boost::asio::ip::udp::endpoint endpoint = *endpoint_iterator;
+        std::shared_ptr<Udp_socket> udp_socket(new Udp_socket(io_service, *this));
+        connect_error = boost::system::error_code();
+        udp_socket->socket().open(endpoint.protocol(), connect_error);
+        if (!connect_error)
+            udp_socket->socket().connect(endpoint, connect_error);
+        if (connect_error) continue;
+
+        Connection_type* connection = new Connection_type(udp_socket, endpoint, *this);
+        udp_socket->start(Udp_socket::Connection_factory());
+        accepted(connection);
+        return;
+    }
+    error(connect_error);
+}
+
+#endif //FANEL_UDP_CONNECTOR_H
@@ -0,0 +1,113 @@
+#ifndef FANEL_UDP_SOCKET_H
+#define FANEL_UDP_SOCKET_H
+
+//Do not include this file directly, include Udp_connection.h, Udp_acceptor.h or Udp_connector.h instead
+
+#include "Connection_manager.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <boost/asio.hpp>
+
+#ifdef THREADSAFE
+    #include <boost/thread/mutex.hpp>
+    #include <boost/thread/locks.hpp>
+#endif
+
+//The largest payload a single udp datagram can carry over ipv4. A busy socket
+//keeps up to UDP_BATCH_SIZE receive buffers of this size, so if you know your
+//datagrams are small, lowering this value saves a lot of memory.
+#ifndef MAX_DATAGRAM_SIZE
+    #define MAX_DATAGRAM_SIZE 65507
+#endif
+
+//The maximum number of datagrams received (recvmmsg) or sent (sendmmsg) with a single system call.
+#ifndef UDP_BATCH_SIZE
+    #define UDP_BATCH_SIZE 16
+#endif
+
+class Udp_connection;
+
+/** \brief A single udp socket shared by all pseudo-connections to its peers.
+ *
+ * Every remote endpoint that sends a datagram to this socket gets its own
+ * Udp_connection, which is handed to the Connection_manager through accepted(),
+ * just like a tcp connection would be. Every datagram is exactly one message.
+ *
+ * Datagrams are received and sent in batches. When the socket becomes readable
+ * as many datagrams as are available (up to UDP_BATCH_SIZE per call) are read
+ * with one recvmmsg call, and all writes queued during one run of the event loop
+ * are sent with one sendmmsg call. On platforms without these calls we fall back
+ * to a non blocking loop of receive_from/send_to calls.
+ *
+ * Receive buffers are allocated when the first datagram arrives, one at first.
+ * Every time a batch fills all of them their number doubles, up to UDP_BATCH_SIZE,
+ * so a socket that only sends, or receives a datagram now and then, stays small.
+ *
+ * The socket is kept alive by the connections that use it (and by the Udp_acceptor
+ * or Udp_connector as long as it accepts), so deleting all connections and
+ * stopping the accept will close it.
+ */
+
+class Udp_socket : public std::enable_shared_from_this<Udp_socket> {
+  public:
+    ///creates a connection for a new peer, an empty factory means datagrams from unknown peers are dropped
+    typedef std::function<Udp_connection*(std::shared_ptr<Udp_socket>, const boost::asio::ip::udp::endpoint&)> Connection_factory;
+
+    Udp_socket(boost::asio::io_service& io_service, Connection_manager& connection_manager);
+    ~Udp_socket();
+
+    boost::asio::ip::udp::socket& socket();
+    boost::asio::io_service& get_io_service();
+
+    //start receiving, the socket must be open
+    void start(Connection_factory factory);
+    //stop creating connections for new peers, existing connections keep working
+    void stop_accept();
+
+    //queue a datagram to the peer of connection, takes ownership of data which must be allocated with malloc
+    void send(Udp_connection* connection, char* data, size_t size);
+
+    void attach(Udp_connection* connection);
+    void detach(Udp_connection* connection);
+
+  private:
+    struct Datagram {
+        boost::asio::ip::udp::endpoint peer;
+        Udp_connection* connection;
+        std::weak_ptr<bool> alive;
+        char* data;
+        size_t size;
+    };
+
+    void start_receive();
+    void handle_readable(const boost::system::error_code& error, std::weak_ptr<Udp_socket> alive);
+    void dispatch(const boost::asio::ip::udp::endpoint& peer, const char* data, size_t size);
+    void receive_error(const boost::system::error_code& error);
+    void grow_receive_buffers();
+
+    void flush(std::weak_ptr<Udp_socket> alive);
+    void handle_writable(const boost::system::error_code& error, std::weak_ptr<Udp_socket> alive);
+    size_t send_batch(boost::system::error_code& error);
+
+    boost::asio::io_service& io_service;
+    Connection_manager& connection_manager;
+    boost::asio::ip::udp::socket socket_;
+    Connection_factory factory;
+    bool connected;
+
+    std::map<boost::asio::ip::udp::endpoint, Udp_connection*> peers;
+    std::deque<Datagram> send_queue;
+    bool send_scheduled;
+    char* receive_buffers;
+    int receive_batch; //the number of receive buffers, 0 until the first datagram arrives
+
+    #ifdef THREADSAFE
+        boost::mutex peers_mutex;
+        boost::mutex send_queue_mutex;
+    #endif
+};
+
+#endif //FANEL_UDP_SOCKET_H